@@ -0,0 +1,415 @@
+// Measures phone-side refresh latency: from the watch asking for weather to
+// WEATHER_REPLY being sent back. Runs src/pkjs under Node against a local
+// mock of the weather and geocode endpoints.
+//
+//   node bench/latency.js [--provider owm|wu|forecast|yahoo] [--iterations 50]
+//                         [--delay 200] [--jitter 100] [--failure-rate 0.05]
+//                         [--gps-delay 500] [--interval 30] [--clear-storage 0]
+//                         [--fix-max-age 60] [--fix-distance 3000]
+//
+// localStorage survives cold starts like it does on a phone unless
+// --clear-storage is 1. Cold starts and periodic refreshes advance a simulated
+// clock by --interval minutes, so cache expiry behaves as it would between
+// real refreshes. Requests carry the interval, --fix-max-age and
+// --fix-distance the way the watch sends its settings.
+//
+// pebble-geocode-mapquest isn't vendored, so 'location change' geocodes
+// through GeocodeStandIn below rather than the library's own handler and
+// message keys. Its numbers are a synthetic estimate and are marked as such
+// in the output.
+
+var http = require('http');
+var path = require('path');
+var url = require('url');
+var Module = require('module');
+
+var PKJS = path.join(__dirname, '..', 'src', 'pkjs');
+
+var log = console.log.bind(console);
+var counters = { gps : 0 };
+var storage = {};
+var clock = { offset : 0 };
+
+var PROVIDERS = { owm : 0, wu : 1, forecast : 2, yahoo : 3 };
+
+var HOSTS = {
+    'api.openweathermap.org' : 'owm',
+    'api.wunderground.com' : 'wu',
+    'api.darksky.net' : 'forecast',
+    'query.yahooapis.com' : 'yahoo',
+    'www.mapquestapi.com' : 'mapquest'
+};
+
+var LOCATIONS = [
+    { latitude : 40.71, longitude : -74.01 },
+    { latitude : 51.51, longitude : -0.13 },
+    { latitude : 35.68, longitude : 139.69 },
+    { latitude : -33.87, longitude : 151.21 }
+];
+
+function parseArgs(argv) {
+    var options = {
+        provider : 'owm',
+        iterations : 50,
+        delay : 200,
+        jitter : 100,
+        failureRate : 0.05,
+        gpsDelay : 500,
+        interval : 30,
+        clearStorage : 0,
+        fixMaxAge : 60,
+        fixDistance : 3000
+    };
+    for (var i = 0; i < argv.length; i += 2) {
+        var key = argv[i].replace(/^--/, '').replace(/-(\w)/g, function(m, c) { return c.toUpperCase(); });
+        if (!(key in options)) throw new Error('Unknown option ' + argv[i]);
+        options[key] = key == 'provider' ? argv[i + 1] : parseFloat(argv[i + 1]);
+    }
+    if (!(options.provider in PROVIDERS)) throw new Error('Unknown provider ' + options.provider);
+    return options;
+}
+
+// Canned responses shaped like each service's real payload
+var responses = {
+    owm : function() {
+        return { name : 'Mock', main : { temp : 288.15, feels_like : 287.5 }, weather : [ { id : 801 } ] };
+    },
+    wu : function() {
+        return { current_observation : { temp_c : 15, feelslike_c : '14.4', icon : 'mostlysunny' } };
+    },
+    forecast : function() {
+        return { currently : { temperature : 15, apparentTemperature : 14.4, icon : 'partly-cloudy-day' } };
+    },
+    yahoo : function() {
+        return { query : { results : { channel : { item : { condition : { temp : '15', code : '30' } } } } } };
+    },
+    mapquest : function(query) {
+        var location = LOCATIONS[Math.abs(hash(query.location || '')) % LOCATIONS.length];
+        return { results : [ { locations : [ { latLng : { lat : location.latitude, lng : location.longitude } } ] } ] };
+    }
+};
+
+function hash(s) {
+    var h = 0;
+    for (var i = 0; i < s.length; i++) h = (h * 31 + s.charCodeAt(i)) | 0;
+    return h;
+}
+
+function startServer(options, callback) {
+    var stats = {};
+    var server = http.createServer(function(req, res) {
+        var parsed = url.parse(req.url, true);
+        var service = parsed.pathname.split('/')[1];
+        stats[service] = (stats[service] || 0) + 1;
+
+        var delay = options.delay + Math.random() * options.jitter;
+        setTimeout(function() {
+            if (!responses[service]) {
+                res.writeHead(404);
+                return res.end();
+            }
+            if (Math.random() < options.failureRate) {
+                res.writeHead(500);
+                return res.end();
+            }
+            res.writeHead(200, { 'Content-Type' : 'application/json' });
+            res.end(JSON.stringify(responses[service](parsed.query)));
+        }, delay);
+    });
+    server.listen(0, '127.0.0.1', function() {
+        callback(server, stats);
+    });
+}
+
+// Minimal XMLHttpRequest that sends every known API host to the mock server
+function xhrFactory(port) {
+    var XHR = function() {
+        this.status = 0;
+        this.responseText = '';
+        this.timeout = 0;
+    };
+    XHR.prototype.open = function(method, target) {
+        var parsed = url.parse(target);
+        var service = HOSTS[parsed.hostname];
+        if (!service) throw new Error('Unmocked host ' + parsed.hostname);
+        this._method = method;
+        this._path = '/' + service + parsed.path;
+    };
+    XHR.prototype.send = function() {
+        var self = this;
+        var req = http.request({ host : '127.0.0.1', port : port, method : this._method, path : this._path }, function(res) {
+            var body = '';
+            res.on('data', function(chunk) { body += chunk; });
+            res.on('end', function() {
+                self.status = res.statusCode;
+                self.responseText = body;
+                if (self.onload) self.onload.call(self);
+            });
+        });
+        req.on('error', function() {
+            if (self.onerror) self.onerror.call(self);
+        });
+        if (this.timeout) {
+            req.setTimeout(this.timeout, function() {
+                req.abort();
+                if (self.ontimeout) self.ontimeout.call(self);
+            });
+        }
+        req.end();
+    };
+    return XHR;
+}
+
+// Stand-in for the phone half of pebble-geocode-mapquest, which isn't vendored.
+// Same MapQuest request, but its own HARNESS_* keys instead of the library's.
+function GeocodeStandIn() {
+    this.appMessageHandler = function(e) {
+        var location = e.payload['HARNESS_GEOCODE'];
+        if (location === undefined) return;
+        var xhr = new XMLHttpRequest();
+        xhr.onload = function() {
+            var json = this.status == 200 ? JSON.parse(this.responseText) : null;
+            var latLng = json && json.results[0].locations[0].latLng;
+            Pebble.sendAppMessage(latLng
+                ? { 'HARNESS_GEOCODED' : 1, 'lat' : Math.round(latLng.lat * 100000), 'lng' : Math.round(latLng.lng * 100000) }
+                : { 'HARNESS_GEOCODED' : 0 });
+        };
+        xhr.onerror = function() {
+            Pebble.sendAppMessage({ 'HARNESS_GEOCODED' : 0 });
+        };
+        xhr.open('GET', 'http://www.mapquestapi.com/geocoding/v1/address?key=mock&location=' + encodeURIComponent(location));
+        xhr.send();
+    };
+}
+
+// A fresh phone: new Pebble object, empty module cache, new localStorage
+function Phone(options) {
+    var listeners = {};
+    var waiting = [];
+    if (options.clearStorage) storage = {};
+
+    global.Pebble = {
+        addEventListener : function(type, fn) {
+            (listeners[type] = listeners[type] || []).push(fn);
+        },
+        sendAppMessage : function(dict, success) {
+            setImmediate(function() {
+                if (success) success();
+                var pending = waiting;
+                waiting = [];
+                pending.forEach(function(w) {
+                    if (w.key in dict) w.callback(dict);
+                    else waiting.push(w);
+                });
+            });
+        },
+        openURL : function() {}
+    };
+
+    global.localStorage = {
+        getItem : function(k) { return k in storage ? storage[k] : null; },
+        setItem : function(k, v) { storage[k] = String(v); },
+        removeItem : function(k) { delete storage[k]; }
+    };
+
+    // Node 21+ ships a read-only navigator global
+    Object.defineProperty(global, 'navigator', { configurable : true, writable : true, value : {
+        geolocation : {
+            getCurrentPosition : function(success, error, opts) {
+                counters.gps++;
+                setTimeout(function() {
+                    success({ coords : LOCATIONS[0], timestamp : Date.now() });
+                }, options.gpsDelay);
+            }
+        }
+    } });
+
+    Object.keys(require.cache).forEach(function(k) {
+        if (k.indexOf(PKJS) === 0) delete require.cache[k];
+    });
+    require(path.join(PKJS, 'index.js'));
+
+    this.emit = function(type, e) {
+        (listeners[type] || []).forEach(function(fn) { fn(e); });
+    };
+
+    // Sends a message from the watch and waits for a reply containing key
+    this.request = function(payload, key, callback) {
+        waiting.push({ key : key, callback : callback });
+        this.emit('appmessage', { payload : payload });
+    };
+
+    this.waitFor = function(key, callback) {
+        waiting.push({ key : key, callback : callback });
+    };
+}
+
+function weatherRequest(options, coords) {
+    var payload = {
+        'WEATHER_REQUEST' : 1,
+        'WEATHER_PROVIDER' : PROVIDERS[options.provider],
+        'WEATHER_KEY' : 'mock',
+        'WEATHER_TTL' : options.interval * 60
+    };
+    if (coords) {
+        payload['WEATHER_LATITUDE'] = coords.latitude;
+        payload['WEATHER_LONGITUDE'] = coords.longitude;
+    } else {
+        payload['WEATHER_FIX_MAX_AGE'] = options.fixMaxAge;
+        payload['WEATHER_FIX_DISTANCE'] = options.fixDistance;
+    }
+    return payload;
+}
+
+// Flags and status bytes of the packed reply, see src/c/weather.c
+function replyOk(dict) {
+    return dict['WEATHER_REPLY'][1] == 4;
+}
+
+function replyCached(dict) {
+    return (dict['WEATHER_REPLY'][0] & (1 << 1)) != 0;
+}
+
+var scenarios = {
+    // Phone app starts, says APP_READY, the watch asks for weather by GPS
+    'cold start' : function(options, done) {
+        clock.offset += options.interval * 60 * 1000;
+        var phone = new Phone(options);
+        var start = process.hrtime();
+        phone.waitFor('APP_READY', function() {
+            phone.request(weatherRequest(options), 'WEATHER_REPLY', function(reply) {
+                done(elapsed(start), reply);
+            });
+        });
+        phone.emit('ready', {});
+    },
+
+    // Settings saved with a new location name: geocode, then fetch by coordinates.
+    // Synthetic, see GeocodeStandIn
+    'location change' : function(options, done, state) {
+        var phone = state.phone = state.phone || new Phone(options);
+        var start = process.hrtime();
+        phone.request({ 'HARNESS_GEOCODE' : 'City ' + state.iteration }, 'HARNESS_GEOCODED', function(geocoded) {
+            if (!geocoded['HARNESS_GEOCODED']) return done(elapsed(start), null);
+            phone.request(weatherRequest(options, { latitude : geocoded.lat, longitude : geocoded.lng }), 'WEATHER_REPLY', function(reply) {
+                done(elapsed(start), reply);
+            });
+        });
+    },
+
+    // Interval timer fires on an already running phone app. The watch starts
+    // its timer when it sends a request, so the next one comes --interval
+    // after the last request rather than after the last reply.
+    'periodic refresh' : function(options, done, state) {
+        var phone = state.phone = state.phone || new Phone(options);
+        var interval = options.interval * 60 * 1000;
+        clock.offset += state.requested ? state.requested + interval - Date.now() : interval;
+        state.requested = Date.now();
+        var start = process.hrtime();
+        phone.request(weatherRequest(options), 'WEATHER_REPLY', function(reply) {
+            done(elapsed(start), reply);
+        });
+    }
+};
+
+// Scenarios that don't run the app's real code path end to end
+var synthetic = { 'location change' : true };
+
+function elapsed(start) {
+    var diff = process.hrtime(start);
+    return diff[0] * 1000 + diff[1] / 1e6;
+}
+
+function percentile(sorted, p) {
+    if (!sorted.length) return NaN;
+    return sorted[Math.min(sorted.length - 1, Math.ceil(p / 100 * sorted.length) - 1)];
+}
+
+function report(name, samples, failures, cached, gpsRequests) {
+    var sorted = samples.slice().sort(function(a, b) { return a - b; });
+    function ms(v) { return isNaN(v) ? '-' : v.toFixed(0) + 'ms'; }
+    log([
+        pad(synthetic[name] ? name + '*' : name, 18),
+        'n=' + pad(String(samples.length), 4),
+        'p50=' + pad(ms(percentile(sorted, 50)), 7),
+        'p90=' + pad(ms(percentile(sorted, 90)), 7),
+        'p99=' + pad(ms(percentile(sorted, 99)), 7),
+        'max=' + pad(ms(sorted[sorted.length - 1]), 7),
+        'failed=' + failures,
+        'cached=' + cached,
+        'gps=' + gpsRequests
+    ].join(' '));
+}
+
+function pad(s, n) {
+    while (s.length < n) s += ' ';
+    return s;
+}
+
+function runScenario(name, options, callback) {
+    var samples = [];
+    var failures = 0;
+    var cached = 0;
+    var state = { iteration : 0 };
+    var gpsBefore = counters.gps;
+
+    (function next() {
+        if (state.iteration >= options.iterations) {
+            report(name, samples, failures, cached, counters.gps - gpsBefore);
+            return callback();
+        }
+        scenarios[name](options, function(ms, reply) {
+            if (reply && replyOk(reply)) samples.push(ms);
+            else failures++;
+            if (reply && replyCached(reply)) cached++;
+            state.iteration++;
+            setImmediate(next);
+        }, state);
+    })();
+}
+
+function main() {
+    var options = parseArgs(process.argv.slice(2));
+
+    var stubs = {
+        'pebble-clay' : function() {},
+        'pebble-geocode-mapquest' : GeocodeStandIn
+    };
+    var load = Module._load;
+    Module._load = function(request) {
+        if (request in stubs) return stubs[request];
+        return load.apply(this, arguments);
+    };
+
+    var now = Date.now;
+    Date.now = function() {
+        return now.call(Date) + clock.offset;
+    };
+
+    // The pkjs code logs freely; keep only our own output
+    console.log = function() {};
+
+    startServer(options, function(server, stats) {
+        global.XMLHttpRequest = xhrFactory(server.address().port);
+        log('provider=' + options.provider + ' iterations=' + options.iterations + ' delay=' + options.delay +
+            'ms jitter=' + options.jitter + 'ms failure-rate=' + options.failureRate + ' gps-delay=' + options.gpsDelay +
+            'ms interval=' + options.interval + 'min clear-storage=' + options.clearStorage +
+            ' fix-max-age=' + options.fixMaxAge + 'min fix-distance=' + options.fixDistance + 'm');
+
+        var names = Object.keys(scenarios);
+        (function run(i) {
+            if (i >= names.length) {
+                if (names.some(function(name) { return synthetic[name]; })) {
+                    log('* synthetic estimate: geocoding uses a stand-in for pebble-geocode-mapquest, not its real handler');
+                }
+                log('requests: ' + JSON.stringify(stats));
+                return server.close();
+            }
+            runScenario(names[i], options, function() {
+                run(i + 1);
+            });
+        })(0);
+    });
+}
+
+main();
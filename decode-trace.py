@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Decode binary trace dumps from `pebble logs`.
+
+Build with TRACE_BINARY defined in src/c/logging.h, then:
+
+    pebble logs | ./decode-trace.py
+
+The app dumps the previous session's events when it starts, and the live
+ring whenever you flick your wrist.
+
+Event ids are LOG_FILE_ID << 12 | line, so this has to run against the same
+sources the app was built from.
+"""
+import glob
+import os
+import re
+import struct
+import sys
+
+SRC = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'src', 'c')
+
+FILE_ID = re.compile(r'^#define LOG_FILE_ID (\d+)')
+FUNCTION = re.compile(r'^[A-Za-z_][\w \*]*?\b(\w+)\s*\([^;]*\)\s*\{')
+CALL = re.compile(r'\blog[fv]\(')
+DUMP = re.compile(r'trace:([0-9a-f]+)')
+EVENT = struct.Struct('<IHH')
+
+
+def load_ids():
+    ids = {}
+    for path in glob.glob(os.path.join(SRC, '*.c')):
+        file_id = None
+        function = '?'
+        with open(path) as f:
+            for number, line in enumerate(f, 1):
+                m = FILE_ID.match(line)
+                if m:
+                    file_id = int(m.group(1))
+                    continue
+                m = FUNCTION.match(line)
+                if m:
+                    function = m.group(1)
+                if file_id is not None and CALL.search(line) and '#define' not in line:
+                    ids[(file_id << 12) | (number & 0x0FFF)] = '{} ({}:{})'.format(function, os.path.basename(path), number)
+    return ids
+
+
+def main():
+    ids = load_ids()
+    start = None
+    for line in sys.stdin:
+        m = DUMP.search(line)
+        if not m:
+            continue
+        data = bytes.fromhex(m.group(1))
+        for offset in range(0, len(data) - EVENT.size + 1, EVENT.size):
+            time, event_id, arg = EVENT.unpack_from(data, offset)
+            ms = (time >> 10) * 1000 + (time & 0x3FF)
+            if start is None:
+                start = ms
+            name = ids.get(event_id, 'unknown 0x{:04x}'.format(event_id))
+            print('{:>10} {:<40} {}'.format(ms - start, name, arg))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,19 @@
+#pragma once
+
+// Subsystems compiled into this build. wscript defines PROFILE_* from the
+// selected build profile; platform capabilities narrow them further.
+
+#ifdef PROFILE_WEATHER
+#define FEATURE_WEATHER
+#ifndef PBL_PLATFORM_APLITE
+#define FEATURE_GEOCODE
+#endif
+#endif
+
+#if defined(PROFILE_HEALTH) && defined(PBL_HEALTH)
+#define FEATURE_HEALTH
+#endif
+
+#ifdef PROFILE_VIBES
+#define FEATURE_VIBES
+#endif
@@ -1,13 +1,14 @@
-#ifndef PBL_PLATFORM_APLITE
+#define LOG_FILE_ID 3
 #include <pebble.h>
+#include "features.h"
+#ifdef FEATURE_GEOCODE
 #include <pebble-events/pebble-events.h>
 #include <pebble-geocode-mapquest/pebble-geocode-mapquest.h>
 #include <@smallstoneapps/linked-list/linked-list.h>
 #include "logging.h"
+#include "persist.h"
 #include "geocode.h"
 
-static const uint32_t PERSIST_KEY_GEOCODE_COORDINATES = 4;
-
 #ifndef GEOCODE_API_KEY
 #pragma message("GEOCODE_API_KEY not defined")
 #define GEOCODE_API_KEY ""
@@ -1,6 +1,7 @@
 #pragma once
 
 //#define TRACE
+//#define TRACE_BINARY
 //#define DEBUG
 
 #ifdef TRACE
@@ -22,4 +23,14 @@
 #define logw(fmt, ...) APP_LOG(APP_LOG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
 #define loge(fmt, ...) APP_LOG(APP_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
 
+#ifdef TRACE_BINARY
+#include "trace.h"
+#ifndef LOG_FILE_ID
+#define LOG_FILE_ID 0
+#endif
+#define logv(arg) trace_event(TRACE_EVENT_ID(LOG_FILE_ID, __LINE__), (uint16_t) (arg))
+#define logf(void) logv(0);
+#else
+#define logv(arg) logt("%s: %d", __func__, (int) (arg))
 #define logf(void) logt("%s", __func__);
+#endif
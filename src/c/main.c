@@ -1,11 +1,20 @@
+#define LOG_FILE_ID 1
 #include <pebble.h>
 #include <ctype.h>
 #include <pebble-events/pebble-events.h>
+#include "features.h"
+#ifdef FEATURE_VIBES
 #include <pebble-hourly-vibes/hourly-vibes.h>
 #include <pebble-connection-vibes/connection-vibes.h>
+#endif
 #include "enamel.h"
+#ifdef FEATURE_WEATHER
 #include "weather.h"
+#endif
 #include "logging.h"
+#ifndef FEATURE_WEATHER
+#include "persist.h"
+#endif
 
 static GFont s_font;
 
@@ -17,8 +26,10 @@ static TextLayer *s_battery_layer;
 #ifndef PBL_PLATFORM_APLITE
 static TextLayer *s_quiet_time_layer;
 #endif
+#ifdef FEATURE_WEATHER
 static TextLayer *s_weather_layer;
-#ifdef PBL_HEALTH
+#endif
+#ifdef FEATURE_HEALTH
 static TextLayer *s_steps_layer;
 #endif
 static Layer *s_hands_layer;
@@ -26,15 +37,48 @@ static Layer *s_hands_layer;
 static struct tm s_tick_time;
 static bool s_connected;
 
+// Updates that arrive while the face is covered are only recorded here and
+// drawn in one pass once it is visible again
+typedef enum {
+    PendingNone = 0,
+    PendingHands = 1 << 0,
+    PendingDate = 1 << 1,
+    PendingBattery = 1 << 2,
+    PendingWeather = 1 << 3,
+    PendingSteps = 1 << 4
+} Pending;
+
+static uint8_t s_pending;
+static bool s_focused = true;
+#if PBL_API_EXISTS(layer_get_unobstructed_bounds)
+static bool s_area_changing;
+#endif
+#ifdef FEATURE_WEATHER
+static bool s_weather_obstructed;
+#endif
+
 static EventHandle s_connection_event_handle;
 static EventHandle s_tick_timer_event_handle;
 static EventHandle s_battery_event_handle;
 static EventHandle s_settings_received_event_handle;
+#ifdef FEATURE_WEATHER
 static EventHandle s_weather_event_handle;
-#ifdef PBL_HEALTH
+#endif
+static EventHandle s_app_focus_event_handle;
+#if PBL_API_EXISTS(layer_get_unobstructed_bounds)
+static EventHandle s_unobstructed_area_event_handle;
+#endif
+#ifdef FEATURE_HEALTH
 static EventHandle s_health_event_handle;
 #endif
 
+static bool prv_is_suspended(void) {
+#if PBL_API_EXISTS(layer_get_unobstructed_bounds)
+    if (s_area_changing) return true;
+#endif
+    return !s_focused;
+}
+
 static void prv_hands_layer_update_proc(Layer *this, GContext *ctx) {
     logf();
     GRect bounds = layer_get_bounds(this);
@@ -128,6 +172,11 @@ static void prv_status_layer_update_proc(Layer *this, GContext *ctx) {
 
 static void prv_battery_state_handler(BatteryChargeState charge_state) {
     logf();
+    if (prv_is_suspended()) {
+        s_pending |= PendingBattery;
+        return;
+    }
+
     static char s[8];
     snprintf(s, sizeof(s), "%d%%", charge_state.charge_percent);
     text_layer_set_text(s_battery_layer, s);
@@ -136,7 +185,8 @@ static void prv_battery_state_handler(BatteryChargeState charge_state) {
 static void prv_app_connection_handler(bool connected) {
     logf();
     s_connected = connected;
-    layer_mark_dirty(s_hands_layer);
+    if (prv_is_suspended()) s_pending |= PendingHands;
+    else layer_mark_dirty(s_hands_layer);
 }
 
 static inline void strupp(char *s) {
@@ -145,6 +195,12 @@ static inline void strupp(char *s) {
 
 static void prv_tick_handler(struct tm *tick_time, TimeUnits units_changed) {
     logf();
+    if (prv_is_suspended()) {
+        s_pending |= PendingHands;
+        if (units_changed & DAY_UNIT) s_pending |= PendingDate;
+        return;
+    }
+
     if (units_changed & DAY_UNIT) {
 #ifdef DEMO
         text_layer_set_text(s_date_layer, "WED 14");
@@ -165,10 +221,19 @@ static void prv_tick_handler(struct tm *tick_time, TimeUnits units_changed) {
     layer_mark_dirty(s_hands_layer);
 }
 
-static void prv_weather_handler(GenericWeatherInfo *info, GenericWeatherStatus status, void *context) {
+#ifdef FEATURE_WEATHER
+static void prv_weather_handler(WeatherInfo *info, WeatherStatus status, void *context) {
     logf();
+    // Refresh interval in minutes and why, for tuning adaptive mode
+    logv(weather_interval_peek() / SECONDS_PER_MINUTE);
+    logv(weather_interval_reason_peek());
+    if (prv_is_suspended()) {
+        s_pending |= PendingWeather;
+        return;
+    }
+
     static char s[8];
-    if (status == GenericWeatherStatusAvailable) {
+    if (status == WeatherStatusAvailable) {
         int unit = atoi(enamel_get_WEATHER_UNIT());
         int16_t temp = unit == 1 ? info->temp_f : info->temp_c;
         snprintf(s, sizeof(s), "%d°", temp);
@@ -178,17 +243,23 @@ static void prv_weather_handler(GenericWeatherInfo *info, GenericWeatherStatus s
         frame.origin.x = temp < 0 ? 1 : 3;
         layer_set_frame(text_layer_get_layer(s_weather_layer), frame);
     } else {
-        text_layer_set_text(s_weather_layer, status != GenericWeatherStatusPending ? "EE" : "??");
+        text_layer_set_text(s_weather_layer, status != WeatherStatusPending ? "EE" : "??");
         GRect frame = layer_get_frame(text_layer_get_layer(s_weather_layer));
         frame.origin.x = 1;
         layer_set_frame(text_layer_get_layer(s_weather_layer), frame);
     }
 }
+#endif
 
-#ifdef PBL_HEALTH
+#ifdef FEATURE_HEALTH
 static void prv_health_handler(HealthEventType event, void *context) {
     logf();
     if (event == HealthEventSignificantUpdate || event == HealthEventMovementUpdate) {
+        if (prv_is_suspended()) {
+            s_pending |= PendingSteps;
+            return;
+        }
+
         time_t start = time_start_of_today();
         time_t end = time(NULL);
         HealthServiceAccessibilityMask mask = health_service_metric_accessible(HealthMetricStepCount, start, end);
@@ -204,13 +275,99 @@ static void prv_health_handler(HealthEventType event, void *context) {
 }
 #endif
 
+static void prv_tick_timer_subscribe(void) {
+    logf();
+    if (s_tick_timer_event_handle)
+        events_tick_timer_service_unsubscribe(s_tick_timer_event_handle);
+
+    // Nobody sees the second hand while something covers the face
+    s_tick_timer_event_handle = events_tick_timer_service_subscribe(
+        enamel_get_SHOW_SECOND_HAND() && s_focused ? SECOND_UNIT : MINUTE_UNIT, prv_tick_handler);
+}
+
+static void prv_flush_pending(void) {
+    logf();
+    uint8_t pending = s_pending;
+    s_pending = PendingNone;
+
+    if (pending & PendingBattery) prv_battery_state_handler(battery_state_service_peek());
+#ifdef FEATURE_WEATHER
+    if (pending & PendingWeather) prv_weather_handler(weather_peek(), weather_status_peek(), NULL);
+#endif
+#ifdef FEATURE_HEALTH
+    if (pending & PendingSteps) prv_health_handler(HealthEventSignificantUpdate, NULL);
+#endif
+    if (pending & (PendingHands | PendingDate)) {
+        time_t now = time(NULL);
+        prv_tick_handler(localtime(&now), (pending & PendingDate) ? DAY_UNIT : SECOND_UNIT);
+    }
+}
+
+static void prv_set_focused(bool focused) {
+    logf();
+    if (s_focused == focused) return;
+    s_focused = focused;
+
+    if (enamel_get_SHOW_SECOND_HAND()) prv_tick_timer_subscribe();
+    if (focused) prv_flush_pending();
+}
+
+static void prv_app_will_focus(bool in_focus) {
+    logf();
+    if (!in_focus) prv_set_focused(false);
+}
+
+static void prv_app_did_focus(bool in_focus) {
+    logf();
+    if (in_focus) prv_set_focused(true);
+}
+
+static void prv_layout(void) {
+    logf();
+#ifdef FEATURE_WEATHER
+    Layer *root_layer = window_get_root_layer(s_window);
+#if PBL_API_EXISTS(layer_get_unobstructed_bounds)
+    GRect bounds = layer_get_unobstructed_bounds(root_layer);
+#else
+    GRect bounds = layer_get_bounds(root_layer);
+#endif
+
+    GRect frame = layer_get_frame(text_layer_get_layer(s_weather_layer));
+    frame.origin.y = bounds.size.h - PBL_IF_RECT_ELSE(40, 45);
+    layer_set_frame(text_layer_get_layer(s_weather_layer), frame);
+
+    // Hide rather than overlap the date and status row
+    GRect date_frame = layer_get_frame(text_layer_get_layer(s_date_layer));
+    s_weather_obstructed = frame.origin.y < date_frame.origin.y + frame.size.h;
+    layer_set_hidden(text_layer_get_layer(s_weather_layer), !enamel_get_WEATHER_ENABLED() || s_weather_obstructed);
+#endif
+}
+
+#if PBL_API_EXISTS(layer_get_unobstructed_bounds)
+static void prv_unobstructed_will_change(GRect final_unobstructed_screen_area, void *context) {
+    logf();
+    s_area_changing = true;
+}
+
+static void prv_unobstructed_did_change(void *context) {
+    logf();
+    s_area_changing = false;
+    prv_layout();
+    if (s_focused) prv_flush_pending();
+}
+#endif
+
 static void prv_settings_received_handler(void *context) {
     logf();
+#ifdef FEATURE_VIBES
     hourly_vibes_set_enabled(enamel_get_HOURLY_VIBE());
     connection_vibes_set_state(atoi(enamel_get_CONNECTION_VIBE()));
-#ifdef PBL_HEALTH
+#endif
+#ifdef FEATURE_HEALTH
+#ifdef FEATURE_VIBES
     connection_vibes_enable_health(enamel_get_ENABLE_HEALTH() || enamel_get_SHOW_STEPS());
     hourly_vibes_enable_health(enamel_get_ENABLE_HEALTH() || enamel_get_SHOW_STEPS());
+#endif
 
     text_layer_set_text_color(s_steps_layer, enamel_get_INVERT_COLORS() ? GColorBlack : GColorWhite);
     layer_set_hidden(text_layer_get_layer(s_steps_layer), !enamel_get_SHOW_STEPS());
@@ -227,10 +384,11 @@ static void prv_settings_received_handler(void *context) {
 #ifndef PBL_PLATFORM_APLITE
     text_layer_set_text_color(s_quiet_time_layer, enamel_get_INVERT_COLORS() ? GColorBlack : GColorWhite);
 #endif
-    text_layer_set_text_color(s_weather_layer, enamel_get_INVERT_COLORS() ? GColorBlack : GColorWhite);
     window_set_background_color(s_window, enamel_get_INVERT_COLORS() ? GColorWhite: GColorBlack);
 
-    layer_set_hidden(text_layer_get_layer(s_weather_layer), !enamel_get_WEATHER_ENABLED());
+#ifdef FEATURE_WEATHER
+    text_layer_set_text_color(s_weather_layer, enamel_get_INVERT_COLORS() ? GColorBlack : GColorWhite);
+    layer_set_hidden(text_layer_get_layer(s_weather_layer), !enamel_get_WEATHER_ENABLED() || s_weather_obstructed);
     if (enamel_get_WEATHER_ENABLED() && s_weather_event_handle == NULL) {
         prv_weather_handler(weather_peek(), weather_status_peek(), NULL);
         s_weather_event_handle = events_weather_subscribe(prv_weather_handler, NULL);
@@ -238,6 +396,7 @@ static void prv_settings_received_handler(void *context) {
         events_weather_unsubscribe(s_weather_event_handle);
         s_battery_event_handle = NULL;
     }
+#endif
 
     if (enamel_get_SHOW_BATTERY() && s_battery_event_handle == NULL) {
         prv_battery_state_handler(battery_state_service_peek());
@@ -247,13 +406,9 @@ static void prv_settings_received_handler(void *context) {
         s_battery_event_handle = NULL;
     }
 
-    if (s_tick_timer_event_handle)
-        events_tick_timer_service_unsubscribe(s_tick_timer_event_handle);
-
     time_t now = time(NULL);
     prv_tick_handler(localtime(&now), DAY_UNIT);
-    s_tick_timer_event_handle = events_tick_timer_service_subscribe(
-        enamel_get_SHOW_SECOND_HAND() ? SECOND_UNIT : MINUTE_UNIT, prv_tick_handler);
+    prv_tick_timer_subscribe();
 }
 
 static void prv_window_load(Window *window) {
@@ -290,13 +445,15 @@ static void prv_window_load(Window *window) {
     layer_add_child(s_status_layer, text_layer_get_layer(s_quiet_time_layer));
 #endif
 
+#ifdef FEATURE_WEATHER
     s_weather_layer = text_layer_create(GRect(0, bounds.size.h - PBL_IF_RECT_ELSE(40, 45), bounds.size.w, 20));
     text_layer_set_background_color(s_weather_layer, GColorClear);
     text_layer_set_font(s_weather_layer, s_font);
     text_layer_set_text_alignment(s_weather_layer, GTextAlignmentCenter);
     layer_add_child(root_layer, text_layer_get_layer(s_weather_layer));
+#endif
 
-#ifdef PBL_HEALTH
+#ifdef FEATURE_HEALTH
     s_steps_layer = text_layer_create(GRect(1, PBL_IF_RECT_ELSE(30, 35), bounds.size.w, 20));
     text_layer_set_background_color(s_steps_layer, GColorClear);
     text_layer_set_font(s_steps_layer, s_font);
@@ -313,26 +470,47 @@ static void prv_window_load(Window *window) {
         .pebble_app_connection_handler = prv_app_connection_handler
     });
 
+    s_focused = app_focus_service_peek_in_focus();
+    prv_layout();
     prv_settings_received_handler(NULL);
     s_settings_received_event_handle = enamel_settings_received_subscribe(prv_settings_received_handler, NULL);
+
+    s_app_focus_event_handle = events_app_focus_service_subscribe_handlers((AppFocusHandlers) {
+        .will_focus = prv_app_will_focus,
+        .did_focus = prv_app_did_focus
+    });
+#if PBL_API_EXISTS(layer_get_unobstructed_bounds)
+    s_unobstructed_area_event_handle = events_unobstructed_area_service_subscribe((UnobstructedAreaHandlers) {
+        .will_change = prv_unobstructed_will_change,
+        .did_change = prv_unobstructed_did_change
+    }, NULL);
+#endif
 }
 
 static void prv_window_unload(Window *window) {
     logf();
-#ifdef PBL_HEALTH
+#if PBL_API_EXISTS(layer_get_unobstructed_bounds)
+    events_unobstructed_area_service_unsubscribe(s_unobstructed_area_event_handle);
+#endif
+    events_app_focus_service_unsubscribe(s_app_focus_event_handle);
+#ifdef FEATURE_HEALTH
     if (s_health_event_handle) events_health_service_events_unsubscribe(s_health_event_handle);
 #endif
+#ifdef FEATURE_WEATHER
     if (s_weather_event_handle) events_weather_unsubscribe(s_weather_event_handle);
+#endif
     if (s_battery_event_handle) events_battery_state_service_unsubscribe(s_battery_event_handle);
     if (s_tick_timer_event_handle) events_tick_timer_service_unsubscribe(s_tick_timer_event_handle);
     enamel_settings_received_unsubscribe(s_settings_received_event_handle);
     events_connection_service_unsubscribe(s_connection_event_handle);
 
     layer_destroy(s_hands_layer);
-#ifdef PBL_HEALTH
+#ifdef FEATURE_HEALTH
     text_layer_destroy(s_steps_layer);
 #endif
+#ifdef FEATURE_WEATHER
     text_layer_destroy(s_weather_layer);
+#endif
 #ifndef PBL_PLATFORM_APLITE
     text_layer_destroy(s_quiet_time_layer);
 #endif
@@ -342,13 +520,32 @@ static void prv_window_unload(Window *window) {
     layer_destroy(s_ticks_layer);
 }
 
+#ifndef FEATURE_WEATHER
+// An earlier build with weather may have left its state behind
+static void prv_forget_weather(void) {
+    logf();
+    for (uint32_t key = PERSIST_KEY_WEATHER_FIRST; key <= PERSIST_KEY_WEATHER_LAST; key++) {
+        if (persist_exists(key)) persist_delete(key);
+    }
+}
+#endif
+
 static void prv_init(void) {
     logf();
+#ifdef TRACE_BINARY
+    trace_init();
+#endif
+#ifndef FEATURE_WEATHER
+    prv_forget_weather();
+#endif
     setlocale(LC_ALL, "");
     s_font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_10));
 
     enamel_init();
+#ifdef FEATURE_WEATHER
     weather_init();
+#endif
+#ifdef FEATURE_VIBES
     connection_vibes_init();
     hourly_vibes_init();
     uint32_t const pattern[] = { 100 };
@@ -356,6 +553,7 @@ static void prv_init(void) {
         .durations = pattern,
         .num_segments = 1
     });
+#endif
     events_app_message_open();
 
     s_window = window_create();
@@ -370,12 +568,19 @@ static void prv_deinit(void) {
     logf();
     window_destroy(s_window);
 
+#ifdef FEATURE_VIBES
     connection_vibes_deinit();
     hourly_vibes_deinit();
+#endif
+#ifdef FEATURE_WEATHER
     weather_deinit();
+#endif
     enamel_deinit();
 
     fonts_unload_custom_font(s_font);
+#ifdef TRACE_BINARY
+    trace_deinit();
+#endif
 }
 
 int main(void) {
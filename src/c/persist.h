@@ -0,0 +1,19 @@
+#pragma once
+
+// Every key the app persists. Each subsystem owns a block of keys, so a build
+// without it can clear the whole block and blocks can't grow into each other.
+// Add new keys inside their owner's block and never renumber existing ones.
+enum {
+    // weather.c and geocode.c
+    PERSIST_KEY_WEATHER_FIRST = 2,
+    PERSIST_KEY_WEATHER_INFO = 2,
+    PERSIST_KEY_WEATHER_STATUS = 3,
+    PERSIST_KEY_GEOCODE_COORDINATES = 4,
+    PERSIST_KEY_WEATHER_HISTORY = 5,
+    PERSIST_KEY_WEATHER_LAST = 15,
+
+    // trace.c: an event count, then the ring in persist-sized chunks
+    PERSIST_KEY_TRACE_COUNT = 16,
+    PERSIST_KEY_TRACE_DATA = 17,
+    PERSIST_KEY_TRACE_LAST = 31
+};
@@ -0,0 +1,120 @@
+#define LOG_FILE_ID 4
+#include <pebble.h>
+#include "logging.h"
+#include "persist.h"
+#ifdef TRACE_BINARY
+
+#define TRACE_BUFFER_LEN PBL_IF_LOW_MEMORY_ELSE(64, 128)
+#define TRACE_EVENTS_PER_KEY ((int) (PERSIST_DATA_MAX_LENGTH / sizeof(TraceEvent)))
+#define TRACE_EVENTS_PER_LINE 8
+// One flick can register as several taps
+#define TRACE_DUMP_MIN_SPACING 5
+
+// time is seconds << 10 | milliseconds, so it wraps every ~48 days
+typedef struct __attribute__((__packed__)) {
+    uint32_t time;
+    uint16_t id;
+    uint16_t arg;
+} TraceEvent;
+
+_Static_assert(PERSIST_KEY_TRACE_DATA + (TRACE_BUFFER_LEN - 1) / TRACE_EVENTS_PER_KEY <= PERSIST_KEY_TRACE_LAST,
+    "trace ring doesn't fit its persist keys");
+
+static TraceEvent s_events[TRACE_BUFFER_LEN];
+static uint16_t s_head;
+static uint16_t s_count;
+
+void trace_event(uint16_t id, uint16_t arg) {
+    time_t seconds;
+    uint16_t ms;
+    time_ms(&seconds, &ms);
+
+    TraceEvent *event = &s_events[s_head];
+    event->time = ((uint32_t) seconds << 10) | ms;
+    event->id = id;
+    event->arg = arg;
+
+    s_head = (s_head + 1) % TRACE_BUFFER_LEN;
+    if (s_count < TRACE_BUFFER_LEN) s_count++;
+}
+
+static void dump_events(const TraceEvent *events, uint16_t count) {
+    static const char hex[] = "0123456789abcdef";
+    char line[TRACE_EVENTS_PER_LINE * sizeof(TraceEvent) * 2 + 1];
+
+    for (uint16_t i = 0; i < count; i += TRACE_EVENTS_PER_LINE) {
+        uint16_t n = count - i < TRACE_EVENTS_PER_LINE ? count - i : TRACE_EVENTS_PER_LINE;
+        const uint8_t *bytes = (const uint8_t *) &events[i];
+        char *p = line;
+        for (size_t j = 0; j < n * sizeof(TraceEvent); j++) {
+            *p++ = hex[bytes[j] >> 4];
+            *p++ = hex[bytes[j] & 0x0F];
+        }
+        *p = '\0';
+        APP_LOG(APP_LOG_LEVEL_INFO, "trace:%s", line);
+    }
+}
+
+typedef void(*TraceChunkHandler)(const TraceEvent *events, uint16_t count, uint16_t index);
+
+// Walks the ring oldest first, one persist-sized chunk at a time
+static void each_chunk(TraceChunkHandler handler) {
+    TraceEvent events[TRACE_EVENTS_PER_KEY];
+    uint16_t start = (s_head + TRACE_BUFFER_LEN - s_count) % TRACE_BUFFER_LEN;
+    for (uint16_t i = 0, index = 0; i < s_count; i += TRACE_EVENTS_PER_KEY, index++) {
+        uint16_t n = s_count - i < TRACE_EVENTS_PER_KEY ? s_count - i : TRACE_EVENTS_PER_KEY;
+        for (uint16_t j = 0; j < n; j++) {
+            events[j] = s_events[(start + i + j) % TRACE_BUFFER_LEN];
+        }
+        handler(events, n, index);
+    }
+}
+
+static void dump_chunk(const TraceEvent *events, uint16_t count, uint16_t index) {
+    dump_events(events, count);
+}
+
+static void persist_chunk(const TraceEvent *events, uint16_t count, uint16_t index) {
+    persist_write_data(PERSIST_KEY_TRACE_DATA + index, events, count * sizeof(TraceEvent));
+}
+
+void trace_dump(void) {
+    each_chunk(dump_chunk);
+}
+
+// Dumps whatever the previous session flushed, then forgets it
+static void dump_persisted(void) {
+    if (!persist_exists(PERSIST_KEY_TRACE_COUNT)) return;
+
+    uint16_t count = persist_read_int(PERSIST_KEY_TRACE_COUNT);
+    TraceEvent events[TRACE_EVENTS_PER_KEY];
+    for (uint16_t i = 0, key = 0; i < count; i += TRACE_EVENTS_PER_KEY, key++) {
+        uint16_t n = count - i < TRACE_EVENTS_PER_KEY ? count - i : TRACE_EVENTS_PER_KEY;
+        if (persist_read_data(PERSIST_KEY_TRACE_DATA + key, events, n * sizeof(TraceEvent)) < 0) break;
+        dump_events(events, n);
+        persist_delete(PERSIST_KEY_TRACE_DATA + key);
+    }
+    persist_delete(PERSIST_KEY_TRACE_COUNT);
+}
+
+// Flick the wrist to dump the ring without restarting the app; nothing else
+// in the app takes taps, so this uses the SDK service directly
+static void tap_handler(AccelAxisType axis, int32_t direction) {
+    static time_t s_last_dump;
+    time_t now = time(NULL);
+    if (now - s_last_dump < TRACE_DUMP_MIN_SPACING) return;
+    s_last_dump = now;
+    trace_dump();
+}
+
+void trace_init(void) {
+    dump_persisted();
+    accel_tap_service_subscribe(tap_handler);
+}
+
+void trace_deinit(void) {
+    accel_tap_service_unsubscribe();
+    each_chunk(persist_chunk);
+    persist_write_int(PERSIST_KEY_TRACE_COUNT, s_count);
+}
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+#include <pebble.h>
+
+// Event ids pack the source file (LOG_FILE_ID) and line of the call site;
+// decode-trace.py maps them back to function names.
+#define TRACE_EVENT_ID(file, line) ((uint16_t) (((file) << 12) | ((line) & 0x0FFF)))
+
+void trace_init(void);
+void trace_deinit(void);
+void trace_event(uint16_t id, uint16_t arg);
+void trace_dump(void);
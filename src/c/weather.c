@@ -1,14 +1,43 @@
+#define LOG_FILE_ID 2
 #include <pebble.h>
+#include "features.h"
+#ifdef FEATURE_WEATHER
 #include <enamel.h>
 #include <pebble-events/pebble-events.h>
-#include <pebble-generic-weather/pebble-generic-weather.h>
 #include <@smallstoneapps/linked-list/linked-list.h>
 #include "logging.h"
+#include "persist.h"
+#ifdef FEATURE_GEOCODE
 #include "geocode.h"
+#endif
 #include "weather.h"
 
-static const uint32_t PERSIST_KEY_WEATHER_INFO = 2;
-static const uint32_t PERSIST_KEY_WEATHER_STATUS = 3;
+// Longest API key we reserve outbox space for
+#define WEATHER_KEY_MAX_LEN 64
+
+// WEATHER_REPLY is a packed little-endian byte array:
+//   [0]    flags, WEATHER_REPLY_FLAG_*
+//   [1]    WeatherStatus
+//   [2..3] int16 temperature in tenths of a degree Celsius
+//   [4..7] uint32 fetch timestamp
+//   [8]    WeatherCondition, only if WEATHER_REPLY_FLAG_CONDITION is set
+// Replies without a reading stop after the status byte.
+#define WEATHER_REPLY_FLAG_CONDITION (1 << 0)
+// The phone reused a recent reading for a nearby position instead of fetching
+#define WEATHER_REPLY_FLAG_CACHED (1 << 1)
+#define WEATHER_REPLY_STATUS_SIZE 2
+#define WEATHER_REPLY_READING_SIZE 8
+#define WEATHER_REPLY_MAX_SIZE 9
+
+// Adaptive mode treats WEATHER_INTERVAL as the shortest interval and grows
+// from there while recent readings barely move
+#define WEATHER_HISTORY_LEN 4
+#define WEATHER_HISTORY_MIN_SPACING (10 * SECONDS_PER_MINUTE)
+#define WEATHER_ADAPTIVE_MAX_FACTOR 4
+#define WEATHER_ADAPTIVE_MAX_INTERVAL (4 * SECONDS_PER_HOUR)
+// Change per hour between consecutive readings, in tenths of a degree Celsius
+#define WEATHER_ADAPTIVE_STABLE_RATE 5
+#define WEATHER_ADAPTIVE_CHANGING_RATE 20
 
 typedef struct {
     EventWeatherHandler handler;
@@ -16,17 +45,36 @@ typedef struct {
 } WeatherHandlerState;
 
 typedef struct {
-    GenericWeatherInfo *info;
-    GenericWeatherStatus status;
+    WeatherInfo *info;
+    WeatherStatus status;
 } WeatherBundle;
 
-static GenericWeatherStatus s_status = GenericWeatherStatusNotYetFetched;
+typedef struct {
+    time_t timestamp;
+    int16_t temp;
+} WeatherSample;
+
+// Oldest sample first; persisted along with the interval it led to
+typedef struct {
+    uint16_t interval;
+    uint8_t reason;
+    uint8_t count;
+    WeatherSample samples[WEATHER_HISTORY_LEN];
+} WeatherHistory;
+
+static WeatherInfo s_info;
+static WeatherStatus s_status = WeatherStatusNotYetFetched;
 
 static LinkedRoot *s_handler_list;
 
 static uint16_t s_interval;
+static uint16_t s_base_interval;
+static bool s_adaptive;
+static WeatherIntervalReason s_interval_reason = WeatherIntervalReasonConfigured;
+static WeatherHistory s_history;
 static const char *s_api_key;
-static GenericWeatherProvider s_provider;
+static uint8_t s_provider;
+static WeatherCoordinates s_location;
 
 static bool s_connected;
 static bool s_ready = false;
@@ -37,7 +85,7 @@ static EventHandle s_app_message_event_handle;
 
 static AppTimer *s_timer;
 
-#ifndef PBL_PLATFORM_APLITE
+#ifdef FEATURE_GEOCODE
 static bool s_use_gps;
 static EventHandle s_geocode_event_handle;
 static char s_location_name[GEOCODE_MAPQUEST_MAX_LOCATION_LEN];
@@ -57,34 +105,201 @@ static bool each_weather_fetched(void *this, void *context) {
     return true;
 }
 
-static void generic_weather_fetch_callback(GenericWeatherInfo *info, GenericWeatherStatus status) {
-    logf();
+static void weather_notify(WeatherStatus status) {
+    logv(status);
     s_status = status;
 
     WeatherBundle bundle = {
-        .info = info,
+        .info = &s_info,
         .status = status
     };
     linked_list_foreach(s_handler_list, each_weather_fetched, &bundle);
 }
 
+static void weather_set_location(WeatherCoordinates location) {
+    logf();
+    s_location = location;
+}
+
+static bool weather_location_is_gps(void) {
+    return s_location.latitude == WEATHER_GPS_LOCATION.latitude && s_location.longitude == WEATHER_GPS_LOCATION.longitude;
+}
+
+static void weather_fetch(void) {
+    logf();
+    // dict_write_cstring would silently drop a key that overflows the outbox
+    if (strlen(s_api_key) >= WEATHER_KEY_MAX_LEN) {
+        logw("api key too long: %d", (int) strlen(s_api_key));
+        weather_notify(WeatherStatusKeyTooLong);
+        return;
+    }
+
+    DictionaryIterator *iter;
+    AppMessageResult result = app_message_outbox_begin(&iter);
+    if (result != APP_MSG_OK) {
+        logw("outbox_begin: %d", result);
+        weather_notify(WeatherStatusFailed);
+        return;
+    }
+
+    dict_write_uint8(iter, MESSAGE_KEY_WEATHER_REQUEST, 1);
+    dict_write_uint8(iter, MESSAGE_KEY_WEATHER_PROVIDER, s_provider);
+    dict_write_cstring(iter, MESSAGE_KEY_WEATHER_KEY, s_api_key);
+    // The phone reuses a nearby reading younger than this, in seconds
+    dict_write_uint32(iter, MESSAGE_KEY_WEATHER_TTL, s_base_interval);
+    if (!weather_location_is_gps()) {
+        dict_write_int32(iter, MESSAGE_KEY_WEATHER_LATITUDE, s_location.latitude);
+        dict_write_int32(iter, MESSAGE_KEY_WEATHER_LONGITUDE, s_location.longitude);
+    } else {
+        // Minutes to trust the last GPS fix, and meters it may be from the last reading
+        dict_write_uint16(iter, MESSAGE_KEY_WEATHER_FIX_MAX_AGE, atoi(enamel_get_WEATHER_FIX_MAX_AGE()));
+        dict_write_uint16(iter, MESSAGE_KEY_WEATHER_FIX_DISTANCE, atoi(enamel_get_WEATHER_FIX_DISTANCE()));
+    }
+
+    result = app_message_outbox_send();
+    if (result != APP_MSG_OK) {
+        logw("outbox_send: %d", result);
+        weather_notify(WeatherStatusFailed);
+        return;
+    }
+    weather_notify(WeatherStatusPending);
+}
+
+static int16_t round_div(int32_t n, int32_t d) {
+    return (n >= 0 ? n + d / 2 : n - d / 2) / d;
+}
+
+static uint16_t adaptive_max_interval(void) {
+    uint32_t max = (uint32_t) s_base_interval * WEATHER_ADAPTIVE_MAX_FACTOR;
+    if (max > WEATHER_ADAPTIVE_MAX_INTERVAL) max = WEATHER_ADAPTIVE_MAX_INTERVAL;
+    return max < s_base_interval ? s_base_interval : max;
+}
+
+static void set_interval(uint16_t interval, WeatherIntervalReason reason) {
+    logf();
+    bool changed = interval != s_interval;
+    s_interval = interval;
+    s_interval_reason = reason;
+    if (changed && s_timer) app_timer_reschedule(s_timer, s_interval * 1000);
+}
+
+// Samples older than the longest interval, give or take some timer drift, no
+// longer describe the current trend; drop them instead of averaging over gaps
+// where the watch was off or disconnected
+static void history_expire(time_t now) {
+    logf();
+    time_t cutoff = now - (adaptive_max_interval() + WEATHER_HISTORY_MIN_SPACING);
+    uint8_t expired = 0;
+    while (expired < s_history.count && s_history.samples[expired].timestamp < cutoff) expired++;
+    if (expired == 0) return;
+
+    s_history.count -= expired;
+    memmove(&s_history.samples[0], &s_history.samples[expired], sizeof(WeatherSample) * s_history.count);
+}
+
+static bool history_record(int16_t temp, time_t timestamp) {
+    logf();
+    history_expire(timestamp);
+    if (s_history.count > 0) {
+        WeatherSample *last = &s_history.samples[s_history.count - 1];
+        // Cached replies repeat a reading we already have, and readings
+        // taken moments apart exaggerate the rate
+        if (timestamp - last->timestamp < WEATHER_HISTORY_MIN_SPACING) return false;
+    }
+
+    if (s_history.count == WEATHER_HISTORY_LEN) {
+        memmove(&s_history.samples[0], &s_history.samples[1], sizeof(WeatherSample) * (WEATHER_HISTORY_LEN - 1));
+        s_history.count--;
+    }
+    s_history.samples[s_history.count++] = (WeatherSample) {
+        .timestamp = timestamp,
+        .temp = temp
+    };
+    return true;
+}
+
+static int32_t history_max_rate(void) {
+    logf();
+    int32_t max = 0;
+    for (uint8_t i = 1; i < s_history.count; i++) {
+        int32_t dt = s_history.samples[i].timestamp - s_history.samples[i - 1].timestamp;
+        if (dt <= 0) continue;
+        int32_t rate = abs(s_history.samples[i].temp - s_history.samples[i - 1].temp) * SECONDS_PER_HOUR / dt;
+        if (rate > max) max = rate;
+    }
+    return max;
+}
+
+static void adapt_interval(int16_t temp, time_t timestamp) {
+    logf();
+    if (!history_record(temp, timestamp) || !s_adaptive) return;
+
+    if (s_history.count < 2) {
+        set_interval(s_base_interval, WeatherIntervalReasonWarmingUp);
+        return;
+    }
+
+    int32_t rate = history_max_rate();
+    logd("rate %ld", (long) rate);
+    if (rate >= WEATHER_ADAPTIVE_CHANGING_RATE) {
+        set_interval(s_base_interval, WeatherIntervalReasonChanging);
+    } else if (rate <= WEATHER_ADAPTIVE_STABLE_RATE) {
+        uint32_t interval = (uint32_t) s_interval * 2;
+        uint16_t max = adaptive_max_interval();
+        set_interval(interval > max ? max : interval, WeatherIntervalReasonStable);
+    } else {
+        set_interval(s_interval, WeatherIntervalReasonSteady);
+    }
+}
+
+static void weather_reply_received(const uint8_t *data, uint16_t length) {
+    logf();
+    if (length < WEATHER_REPLY_STATUS_SIZE) {
+        logw("short reply: %d", length);
+        return;
+    }
+
+    WeatherStatus status = data[1];
+    if (status == WeatherStatusAvailable) {
+        if (length < WEATHER_REPLY_READING_SIZE) {
+            logw("short reading: %d", length);
+            weather_notify(WeatherStatusFailed);
+            return;
+        }
+
+        int16_t temp = (int16_t) (data[2] | (data[3] << 8));
+        s_info.temp_c = round_div(temp, 10);
+        s_info.temp_f = round_div(temp * 9 + 1600, 50);
+        s_info.timestamp = (time_t) (data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t) data[7] << 24));
+        s_info.condition = (data[0] & WEATHER_REPLY_FLAG_CONDITION) && length > WEATHER_REPLY_READING_SIZE
+            ? data[WEATHER_REPLY_READING_SIZE] : WeatherConditionUnknown;
+        s_info.cached = data[0] & WEATHER_REPLY_FLAG_CACHED;
+        logd("%d %ld %d %d", temp, s_info.timestamp, s_info.condition, s_info.cached);
+        // A cached reading says nothing new about the trend
+        if (!s_info.cached) adapt_interval(temp, s_info.timestamp);
+    } else if (s_adaptive && status != WeatherStatusPending) {
+        set_interval(s_base_interval, WeatherIntervalReasonStale);
+    }
+    weather_notify(status);
+}
+
 static void app_timer_callback(void *context) {
     logf();
-    generic_weather_fetch(generic_weather_fetch_callback);
+    weather_fetch();
     s_timer = app_timer_register(s_interval * 1000, app_timer_callback, NULL);
 }
 
 static void fetch_or_setup_timer(void) {
     logf();
-    GenericWeatherInfo *info = generic_weather_peek();
     time_t now = time(NULL);
-    logd("%ld - %ld", now, info->timestamp);
-    if (now - info->timestamp > s_interval) {
-        generic_weather_fetch(generic_weather_fetch_callback);
+    logd("%ld - %ld", now, s_info.timestamp);
+    if (now - s_info.timestamp > s_interval) {
+        if (s_adaptive) set_interval(s_base_interval, WeatherIntervalReasonStale);
+        weather_fetch();
         s_timer = app_timer_register(s_interval * 1000, app_timer_callback, NULL);
     } else {
-        logd("%ld", s_interval - (now - info->timestamp));
-        s_timer = app_timer_register((s_interval - (now - info->timestamp)) * 1000, app_timer_callback, NULL);
+        logd("%ld", s_interval - (now - s_info.timestamp));
+        s_timer = app_timer_register((s_interval - (now - s_info.timestamp)) * 1000, app_timer_callback, NULL);
     }
 }
 
@@ -95,21 +310,21 @@ static void pebble_app_connection_handler(bool connected) {
     s_connected = connected;
 }
 
-#ifndef PBL_PLATFORM_APLITE
+#ifdef FEATURE_GEOCODE
 static void geocode_handler(GeocodeMapquestCoordinates *coordinates, GeocodeMapquestStatus status, void *context) {
     logf();
     if (status == GeocodeMapquestStatusAvailable) {
-        generic_weather_set_location((GenericWeatherCoordinates) {
+        weather_set_location((WeatherCoordinates) {
             .latitude = coordinates->latitude,
             .longitude = coordinates->longitude
         });
     } else if (status != GeocodeMapquestStatusPending) {
-        generic_weather_set_location(GENERIC_WEATHER_GPS_LOCATION);
+        weather_set_location(WEATHER_GPS_LOCATION);
     }
     if (status != GeocodeMapquestStatusPending) {
         cancel_timer();
         if (s_ready && s_connected && linked_list_count(s_handler_list) > 0) {
-            generic_weather_fetch(generic_weather_fetch_callback);
+            weather_fetch();
             s_timer = app_timer_register(s_interval * 1000, app_timer_callback, NULL);
         }
     }
@@ -119,37 +334,40 @@ static void geocode_handler(GeocodeMapquestCoordinates *coordinates, GeocodeMapq
 static void settings_handler(void *context) {
     logf();
     const char *api_key = enamel_get_WEATHER_KEY();
-    GenericWeatherProvider provider = atoi(enamel_get_WEATHER_PROVIDER());
+    uint8_t provider = atoi(enamel_get_WEATHER_PROVIDER());
     uint32_t interval = atoi(enamel_get_WEATHER_INTERVAL()) * SECONDS_PER_MINUTE;
-#ifndef PBL_PLATFORM_APLITE
+    bool adaptive = enamel_get_WEATHER_ADAPTIVE();
+#ifdef FEATURE_GEOCODE
     bool use_gps = enamel_get_WEATHER_USE_GPS();
     const char *location_name = enamel_get_WEATHER_LOCATION_NAME();
 #endif
     bool fetch_weather = false;
 
     if (strcmp(api_key, s_api_key) != 0) {
-        generic_weather_set_api_key(api_key);
         s_api_key = api_key;
         fetch_weather = true;
     }
 
     if (provider != s_provider) {
-        generic_weather_set_provider(provider);
         s_provider = provider;
         fetch_weather = true;
     }
 
-    if (interval != s_interval) {
-        s_interval = interval;
+    if (interval != s_base_interval || adaptive != s_adaptive) {
+        s_base_interval = interval;
+        s_adaptive = adaptive;
+        s_interval = s_base_interval;
+        s_interval_reason = WeatherIntervalReasonConfigured;
+        s_history.count = 0;
         fetch_weather = true;
     }
 
-#ifndef PBL_PLATFORM_APLITE
+#ifdef FEATURE_GEOCODE
     if (use_gps != s_use_gps || strcmp(location_name, s_location_name) != 0) {
         s_use_gps = use_gps;
         strncpy(s_location_name, location_name, sizeof(s_location_name));
         if (use_gps) {
-            generic_weather_set_location(GENERIC_WEATHER_GPS_LOCATION);
+            weather_set_location(WEATHER_GPS_LOCATION);
             fetch_weather = true;
         } else {
             geocode_fetch(s_location_name);
@@ -161,7 +379,7 @@ static void settings_handler(void *context) {
     if (fetch_weather) {
         cancel_timer();
         if (s_ready && s_connected && linked_list_count(s_handler_list) > 0) {
-            generic_weather_fetch(generic_weather_fetch_callback);
+            weather_fetch();
             s_timer = app_timer_register(s_interval * 1000, app_timer_callback, NULL);
         }
     }
@@ -174,45 +392,66 @@ static void inbox_received(DictionaryIterator *iterator, void *context) {
         s_ready = true;
         if (s_connected && linked_list_count(s_handler_list) > 0) fetch_or_setup_timer();
     }
+
+    tuple = dict_find(iterator, MESSAGE_KEY_WEATHER_REPLY);
+    if (tuple && tuple->type == TUPLE_BYTE_ARRAY) {
+        weather_reply_received(tuple->value->data, tuple->length);
+    }
 }
 
 void weather_init(void) {
     logf();
-    s_status = persist_exists(PERSIST_KEY_WEATHER_STATUS) ? persist_read_int(PERSIST_KEY_WEATHER_STATUS) : GenericWeatherStatusNotYetFetched;
+    s_status = persist_exists(PERSIST_KEY_WEATHER_STATUS) ? persist_read_int(PERSIST_KEY_WEATHER_STATUS) : WeatherStatusNotYetFetched;
+    if (persist_get_size(PERSIST_KEY_WEATHER_INFO) == sizeof(WeatherInfo)) {
+        persist_read_data(PERSIST_KEY_WEATHER_INFO, &s_info, sizeof(WeatherInfo));
+    } else {
+        s_info = (WeatherInfo) { .condition = WeatherConditionUnknown };
+        if (s_status == WeatherStatusAvailable) s_status = WeatherStatusNotYetFetched;
+    }
 
     s_handler_list = linked_list_create_root();
 
-    s_interval = atoi(enamel_get_WEATHER_INTERVAL()) * SECONDS_PER_MINUTE;
+    s_base_interval = atoi(enamel_get_WEATHER_INTERVAL()) * SECONDS_PER_MINUTE;
+    s_adaptive = enamel_get_WEATHER_ADAPTIVE();
+    s_interval = s_base_interval;
+    if (persist_get_size(PERSIST_KEY_WEATHER_HISTORY) == sizeof(WeatherHistory)) {
+        persist_read_data(PERSIST_KEY_WEATHER_HISTORY, &s_history, sizeof(WeatherHistory));
+        history_expire(time(NULL));
+        if (s_adaptive && s_history.count > 0 && s_history.interval >= s_base_interval && s_history.interval <= adaptive_max_interval()) {
+            s_interval = s_history.interval;
+            s_interval_reason = s_history.reason;
+        }
+    }
     s_api_key = enamel_get_WEATHER_KEY();
     s_provider = atoi(enamel_get_WEATHER_PROVIDER());
-#ifndef PBL_PLATFORM_APLITE
+#ifdef FEATURE_GEOCODE
     s_use_gps = enamel_get_WEATHER_USE_GPS();
 #endif
 
-    generic_weather_init();
-#ifndef PBL_PLATFORM_APLITE
+#ifdef FEATURE_GEOCODE
     geocode_init();
 #endif
 
-    generic_weather_set_api_key(s_api_key);
-    generic_weather_set_provider(s_provider);
-    generic_weather_set_feels_like(true);
-    generic_weather_load(PERSIST_KEY_WEATHER_INFO);
+    // Size the buffers for our own messages; pebble-events keeps the largest request
+    events_app_message_request_inbox_size(dict_calc_buffer_size(1, sizeof(int32_t)));
+    events_app_message_request_inbox_size(dict_calc_buffer_size(1, WEATHER_REPLY_MAX_SIZE));
+    events_app_message_request_outbox_size(dict_calc_buffer_size(6, sizeof(uint8_t), sizeof(uint8_t),
+        WEATHER_KEY_MAX_LEN, sizeof(uint32_t), sizeof(int32_t), sizeof(int32_t)));
 
-#ifndef PBL_PLATFORM_APLITE
+#ifdef FEATURE_GEOCODE
     strncpy(s_location_name, enamel_get_WEATHER_LOCATION_NAME(), sizeof(s_location_name));
     GeocodeMapquestCoordinates *coordinates = geocode_peek();
     if (s_use_gps || coordinates == NULL || strlen(s_location_name) == 0) {
-        generic_weather_set_location(GENERIC_WEATHER_GPS_LOCATION);
+        weather_set_location(WEATHER_GPS_LOCATION);
     } else {
-        generic_weather_set_location((GenericWeatherCoordinates) {
+        weather_set_location((WeatherCoordinates) {
             .latitude = coordinates->latitude,
             .longitude = coordinates->longitude
         });
     }
     s_geocode_event_handle = events_geocode_subscribe(geocode_handler, NULL);
 #else
-    generic_weather_set_location(GENERIC_WEATHER_GPS_LOCATION);
+    weather_set_location(WEATHER_GPS_LOCATION);
 #endif
 
     s_settings_event_handle = enamel_settings_received_subscribe(settings_handler, NULL);
@@ -234,15 +473,16 @@ void weather_deinit(void) {
     events_app_message_unsubscribe(s_app_message_event_handle);
     events_connection_service_unsubscribe(s_connection_event_handle);
     enamel_settings_received_unsubscribe(s_settings_event_handle);
-#ifndef PBL_PLATFORM_APLITE
+#ifdef FEATURE_GEOCODE
     events_geocode_unsubscribe(s_geocode_event_handle);
 #endif
-    generic_weather_save(PERSIST_KEY_WEATHER_INFO);
-    generic_weather_deinit();
-
+    persist_write_data(PERSIST_KEY_WEATHER_INFO, &s_info, sizeof(WeatherInfo));
     persist_write_int(PERSIST_KEY_WEATHER_STATUS, s_status);
+    s_history.interval = s_interval;
+    s_history.reason = s_interval_reason;
+    persist_write_data(PERSIST_KEY_WEATHER_HISTORY, &s_history, sizeof(WeatherHistory));
 
-#ifndef PBL_PLATFORM_APLITE
+#ifdef FEATURE_GEOCODE
     geocode_deinit();
 #endif
 
@@ -274,7 +514,23 @@ void events_weather_unsubscribe(EventHandle handle) {
     if (linked_list_count(s_handler_list) == 0) cancel_timer();
 }
 
-GenericWeatherStatus weather_status_peek(void) {
+WeatherInfo *weather_peek(void) {
+    logf();
+    return &s_info;
+}
+
+WeatherStatus weather_status_peek(void) {
     logf();
     return s_status;
 }
+
+uint16_t weather_interval_peek(void) {
+    logf();
+    return s_interval;
+}
+
+WeatherIntervalReason weather_interval_reason_peek(void) {
+    logf();
+    return s_interval_reason;
+}
+#endif
@@ -1,14 +1,68 @@
 #pragma once
-#include <pebble-generic-weather/pebble-generic-weather.h>
+#include <pebble.h>
 
 typedef void* EventHandle;
 
-typedef void(*EventWeatherHandler)(GenericWeatherInfo *info, GenericWeatherStatus status, void *context);
+typedef enum {
+    WeatherStatusNotYetFetched = 0,
+    WeatherStatusBluetoothDisconnected,
+    WeatherStatusPending,
+    WeatherStatusFailed,
+    WeatherStatusAvailable,
+    WeatherStatusBadKey,
+    WeatherStatusLocationUnavailable,
+    // The API key doesn't fit in the outbox, so no request was sent
+    WeatherStatusKeyTooLong
+} WeatherStatus;
+
+typedef enum {
+    WeatherConditionClearSky = 0,
+    WeatherConditionFewClouds,
+    WeatherConditionScatteredClouds,
+    WeatherConditionBrokenClouds,
+    WeatherConditionShowerRain,
+    WeatherConditionRain,
+    WeatherConditionThunderstorm,
+    WeatherConditionSnow,
+    WeatherConditionMist,
+    WeatherConditionUnknown = 0xFF
+} WeatherCondition;
+
+typedef struct {
+    int16_t temp_c;
+    int16_t temp_f;
+    time_t timestamp;
+    WeatherCondition condition;
+    // Served from the phone's cache rather than a fresh fetch
+    bool cached;
+} WeatherInfo;
+
+// Coordinates are degrees * 100000, same as pebble-geocode-mapquest
+typedef struct {
+    int32_t latitude;
+    int32_t longitude;
+} WeatherCoordinates;
+
+#define WEATHER_GPS_LOCATION (WeatherCoordinates) { .latitude = (int32_t) 0xFFFFFFFF, .longitude = (int32_t) 0xFFFFFFFF }
+
+// Why the refresh interval is what it is, for debugging adaptive mode
+typedef enum {
+    WeatherIntervalReasonConfigured = 0,
+    WeatherIntervalReasonWarmingUp,
+    WeatherIntervalReasonStable,
+    WeatherIntervalReasonSteady,
+    WeatherIntervalReasonChanging,
+    WeatherIntervalReasonStale
+} WeatherIntervalReason;
+
+typedef void(*EventWeatherHandler)(WeatherInfo *info, WeatherStatus status, void *context);
 
 void weather_init(void);
 void weather_deinit(void);
 
 EventHandle events_weather_subscribe(EventWeatherHandler handler, void *context);
 void events_weather_unsubscribe(EventHandle handle);
-#define weather_peek generic_weather_peek
-GenericWeatherStatus weather_status_peek(void);
+WeatherInfo *weather_peek(void);
+WeatherStatus weather_status_peek(void);
+uint16_t weather_interval_peek(void);
+WeatherIntervalReason weather_interval_reason_peek(void);
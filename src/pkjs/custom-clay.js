@@ -17,6 +17,7 @@ module.exports = function(minified) {
         var masterKeyPin = Clay.getItemById('masterKeyPin');
         var masterKeyButton = Clay.getItemById('masterKeyButton');
         var masterKeyText = Clay.getItemById('masterKeyText');
+        if (!weatherProvider || !masterKeyText) return;
 
         masterKeyText.hide();
 
@@ -68,31 +69,46 @@ module.exports = function(minified) {
     Clay.on(Clay.EVENTS.AFTER_BUILD, function() {
         var watchInfo = Clay.meta.activeWatchInfo;
 
+        // Build profiles can leave out the weather, health and vibes items
+        var gpsToggle = Clay.getItemByMessageKey('WEATHER_USE_GPS');
         if (watchInfo.platform != 'aplite') {
-            var gpsToggle = Clay.getItemByMessageKey('WEATHER_USE_GPS');
             var locationInput = Clay.getItemByMessageKey('WEATHER_LOCATION_NAME');
-            gpsToggle.on('change', function() {
-                if (gpsToggle.get()) locationInput.hide();
-                else locationInput.show();
-            }).trigger('change');
+            var fixItems = [
+                Clay.getItemByMessageKey('WEATHER_FIX_MAX_AGE'),
+                Clay.getItemByMessageKey('WEATHER_FIX_DISTANCE')
+            ];
+            if (gpsToggle) {
+                gpsToggle.on('change', function() {
+                    if (gpsToggle.get()) locationInput.hide();
+                    else locationInput.show();
+                    fixItems.forEach(function(i) {
+                        if (gpsToggle.get()) i.show();
+                        else i.hide();
+                    });
+                }).trigger('change');
+            }
 
             var stepsToggle = Clay.getItemByMessageKey('SHOW_STEPS');
             var healthToggle = Clay.getItemByMessageKey('ENABLE_HEALTH');
-            stepsToggle.on('change', function() {
-                if (stepsToggle.get()) healthToggle.hide();
-                else healthToggle.show();
-            }).trigger('change');
+            if (stepsToggle && healthToggle) {
+                stepsToggle.on('change', function() {
+                    if (stepsToggle.get()) healthToggle.hide();
+                    else healthToggle.show();
+                }).trigger('change');
+            }
         }
 
         var weatherEnabled = Clay.getItemByMessageKey('WEATHER_ENABLED');
-        weatherEnabled.on('change', function() {
-            var enabled = this.get();
-            Clay.getItemsByGroup('weather').forEach(function(i) {
-                if (enabled) i.show();
-                else i.hide();
-            });
-            Clay.getItemByMessageKey('WEATHER_USE_GPS').trigger('change');
-        }).trigger('change');
+        if (weatherEnabled) {
+            weatherEnabled.on('change', function() {
+                var enabled = this.get();
+                Clay.getItemsByGroup('weather').forEach(function(i) {
+                    if (enabled) i.show();
+                    else i.hide();
+                });
+                if (gpsToggle) gpsToggle.trigger('change');
+            }).trigger('change');
+        }
 
         configureWeather();
     });
@@ -3,14 +3,14 @@ var config = require('./config.json');
 var customClay = require('./custom-clay');
 var clay = new Clay(config, customClay);
 
-var GenericWeather = require('pebble-generic-weather');
-var genericWeather = new GenericWeather();
+var Weather = require('./weather');
+var weather = new Weather();
 
 var GeocodeMapquest = require('pebble-geocode-mapquest');
 var geocodeMapquest = new GeocodeMapquest();
 
 Pebble.addEventListener('appmessage', function(e) {
-    genericWeather.appMessageHandler(e);
+    weather.appMessageHandler(e);
     geocodeMapquest.appMessageHandler(e);
 });
 
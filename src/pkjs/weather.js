@@ -0,0 +1,325 @@
+// Fetches the current temperature for the watch and replies with the packed
+// WEATHER_REPLY byte array described in src/c/weather.c.
+
+var Status = {
+    FAILED : 3,
+    AVAILABLE : 4,
+    BAD_KEY : 5,
+    LOCATION_UNAVAILABLE : 6
+};
+
+var Condition = {
+    CLEAR_SKY : 0,
+    FEW_CLOUDS : 1,
+    SCATTERED_CLOUDS : 2,
+    BROKEN_CLOUDS : 3,
+    SHOWER_RAIN : 4,
+    RAIN : 5,
+    THUNDERSTORM : 6,
+    SNOW : 7,
+    MIST : 8
+};
+
+var FLAG_CONDITION = 1 << 0;
+var FLAG_CACHED = 1 << 1;
+
+var STORAGE_FIX = 'weather-fix';
+var STORAGE_READING = 'weather-reading';
+
+// Used when a request doesn't carry its own; the watch sends all three from
+// its settings, see requestOptions()
+var DEFAULTS = {
+    // How long a GPS fix is trusted before asking for a new one
+    fixMaxAge : 60 * 60 * 1000,
+    // How far apart two positions can be and still share a reading, in meters
+    distanceThreshold : 3000,
+    // How long a reading can be reused for a nearby position; the shortest
+    // interval the watch offers
+    weatherTtl : 15 * 60 * 1000
+};
+
+var Provider = {
+    OWM : 0,
+    WU : 1,
+    FORECAST : 2,
+    YAHOO : 3
+};
+
+var KELVIN = 273.15;
+
+function owmCondition(id) {
+    if (id >= 200 && id < 300) return Condition.THUNDERSTORM;
+    if (id >= 300 && id < 400) return Condition.SHOWER_RAIN;
+    if (id >= 520 && id < 600) return Condition.SHOWER_RAIN;
+    if (id >= 500 && id < 600) return Condition.RAIN;
+    if (id >= 600 && id < 700) return Condition.SNOW;
+    if (id >= 700 && id < 800) return Condition.MIST;
+    if (id == 800) return Condition.CLEAR_SKY;
+    if (id == 801) return Condition.FEW_CLOUDS;
+    if (id == 802) return Condition.SCATTERED_CLOUDS;
+    if (id > 802 && id < 900) return Condition.BROKEN_CLOUDS;
+    return undefined;
+}
+
+var iconConditions = {
+    'clear' : Condition.CLEAR_SKY,
+    'clear-day' : Condition.CLEAR_SKY,
+    'clear-night' : Condition.CLEAR_SKY,
+    'sunny' : Condition.CLEAR_SKY,
+    'mostlysunny' : Condition.FEW_CLOUDS,
+    'partlycloudy' : Condition.SCATTERED_CLOUDS,
+    'partly-cloudy-day' : Condition.SCATTERED_CLOUDS,
+    'partly-cloudy-night' : Condition.SCATTERED_CLOUDS,
+    'partlysunny' : Condition.BROKEN_CLOUDS,
+    'mostlycloudy' : Condition.BROKEN_CLOUDS,
+    'cloudy' : Condition.BROKEN_CLOUDS,
+    'chancerain' : Condition.SHOWER_RAIN,
+    'rain' : Condition.RAIN,
+    'chancetstorms' : Condition.THUNDERSTORM,
+    'tstorms' : Condition.THUNDERSTORM,
+    'chancesnow' : Condition.SNOW,
+    'chanceflurries' : Condition.SNOW,
+    'flurries' : Condition.SNOW,
+    'snow' : Condition.SNOW,
+    'chancesleet' : Condition.SNOW,
+    'sleet' : Condition.SNOW,
+    'fog' : Condition.MIST,
+    'hazy' : Condition.MIST
+};
+
+function yahooCondition(code) {
+    if (code <= 4 || (code >= 37 && code <= 39) || code == 45 || code == 47) return Condition.THUNDERSTORM;
+    if (code <= 18 || code == 35 || code == 41 || code == 42 || code == 43 || code == 46) return Condition.SNOW;
+    if (code <= 22) return Condition.MIST;
+    if (code <= 24) return undefined;
+    if (code <= 28) return Condition.BROKEN_CLOUDS;
+    if (code <= 30 || code == 44) return Condition.SCATTERED_CLOUDS;
+    if (code <= 32 || code == 36) return Condition.CLEAR_SKY;
+    if (code <= 34) return Condition.FEW_CLOUDS;
+    if (code == 40) return Condition.SHOWER_RAIN;
+    return undefined;
+}
+
+function distance(a, b) {
+    var rad = Math.PI / 180;
+    var dLat = (b.latitude - a.latitude) * rad;
+    var dLon = (b.longitude - a.longitude) * rad;
+    var h = Math.sin(dLat / 2) * Math.sin(dLat / 2) +
+        Math.cos(a.latitude * rad) * Math.cos(b.latitude * rad) * Math.sin(dLon / 2) * Math.sin(dLon / 2);
+    return 2 * 6371000 * Math.asin(Math.sqrt(h));
+}
+
+// Overrides options with whatever the watch sent along with WEATHER_REQUEST
+function requestOptions(options, payload) {
+    var merged = {};
+    for (var k in options) merged[k] = options[k];
+    if ('WEATHER_TTL' in payload) merged.weatherTtl = payload['WEATHER_TTL'] * 1000;
+    if ('WEATHER_FIX_MAX_AGE' in payload) merged.fixMaxAge = payload['WEATHER_FIX_MAX_AGE'] * 60 * 1000;
+    if ('WEATHER_FIX_DISTANCE' in payload) merged.distanceThreshold = payload['WEATHER_FIX_DISTANCE'];
+    return merged;
+}
+
+function number(value) {
+    var n = parseFloat(value);
+    return isNaN(n) ? undefined : n;
+}
+
+var Weather = function(options) {
+    this._timeout = 15000;
+    this._options = {};
+    for (var k in DEFAULTS) {
+        this._options[k] = options && k in options ? options[k] : DEFAULTS[k];
+    }
+
+    this._request = function(url, callback) {
+        var xhr = new XMLHttpRequest();
+        xhr.onload = function() {
+            var json;
+            try {
+                json = JSON.parse(this.responseText);
+            } catch (e) {
+                json = undefined;
+            }
+            callback(this.status, json);
+        };
+        xhr.onerror = xhr.ontimeout = function() {
+            callback(0);
+        };
+        xhr.open('GET', url);
+        xhr.timeout = this._timeout;
+        xhr.send();
+    };
+
+    // Each provider calls back with (status, tempC, condition)
+    this._providers = {};
+
+    this._providers[Provider.OWM] = function(key, coords, callback) {
+        var url = 'https://api.openweathermap.org/data/2.5/weather?lat=' + coords.latitude +
+            '&lon=' + coords.longitude + '&appid=' + key;
+        this._request(url, function(status, json) {
+            if (status == 401) return callback(Status.BAD_KEY);
+            if (status != 200 || !json || !json.main) return callback(Status.FAILED);
+            var temp = number(json.main.feels_like);
+            if (temp === undefined) temp = number(json.main.temp);
+            if (temp === undefined) return callback(Status.FAILED);
+            callback(Status.AVAILABLE, temp - KELVIN, json.weather && json.weather[0] ? owmCondition(json.weather[0].id) : undefined);
+        });
+    };
+
+    this._providers[Provider.WU] = function(key, coords, callback) {
+        var url = 'https://api.wunderground.com/api/' + key + '/conditions/q/' +
+            coords.latitude + ',' + coords.longitude + '.json';
+        this._request(url, function(status, json) {
+            if (status != 200 || !json) return callback(Status.FAILED);
+            if (json.response && json.response.error) {
+                return callback(json.response.error.type == 'keynotfound' ? Status.BAD_KEY : Status.FAILED);
+            }
+            var observation = json.current_observation;
+            if (!observation) return callback(Status.FAILED);
+            var temp = number(observation.feelslike_c);
+            if (temp === undefined) temp = number(observation.temp_c);
+            if (temp === undefined) return callback(Status.FAILED);
+            callback(Status.AVAILABLE, temp, iconConditions[observation.icon]);
+        });
+    };
+
+    this._providers[Provider.FORECAST] = function(key, coords, callback) {
+        var url = 'https://api.darksky.net/forecast/' + key + '/' + coords.latitude + ',' + coords.longitude +
+            '?units=si&exclude=minutely,hourly,daily,alerts,flags';
+        this._request(url, function(status, json) {
+            if (status == 403) return callback(Status.BAD_KEY);
+            if (status != 200 || !json || !json.currently) return callback(Status.FAILED);
+            var temp = number(json.currently.apparentTemperature);
+            if (temp === undefined) temp = number(json.currently.temperature);
+            if (temp === undefined) return callback(Status.FAILED);
+            callback(Status.AVAILABLE, temp, iconConditions[json.currently.icon]);
+        });
+    };
+
+    this._providers[Provider.YAHOO] = function(key, coords, callback) {
+        var query = 'select item.condition from weather.forecast where woeid in ' +
+            '(select woeid from geo.places(1) where text="(' + coords.latitude + ',' + coords.longitude + ')") and u="c"';
+        var url = 'https://query.yahooapis.com/v1/public/yql?format=json&q=' + encodeURIComponent(query);
+        this._request(url, function(status, json) {
+            if (status != 200 || !json || !json.query || !json.query.results) return callback(Status.FAILED);
+            var condition = json.query.results.channel.item.condition;
+            var temp = number(condition.temp);
+            if (temp === undefined) return callback(Status.FAILED);
+            callback(Status.AVAILABLE, temp, yahooCondition(parseInt(condition.code, 10)));
+        });
+    };
+
+    this._pack = function(status, reading) {
+        if (status != Status.AVAILABLE) return [ 0, status ];
+
+        var temp = Math.round(reading.tempC * 10) & 0xFFFF;
+        var timestamp = Math.round(reading.timestamp / 1000);
+        var data = [
+            reading.cached ? FLAG_CACHED : 0,
+            status,
+            temp & 0xFF, (temp >> 8) & 0xFF,
+            timestamp & 0xFF, (timestamp >>> 8) & 0xFF, (timestamp >>> 16) & 0xFF, (timestamp >>> 24) & 0xFF
+        ];
+        if (reading.condition !== undefined) {
+            data[0] |= FLAG_CONDITION;
+            data.push(reading.condition);
+        }
+        return data;
+    };
+
+    this._reply = function(status, reading) {
+        var data = this._pack(status, reading);
+        console.log('weather reply: ' + JSON.stringify(data));
+        Pebble.sendAppMessage({ 'WEATHER_REPLY' : data });
+    };
+
+    this._load = function(key) {
+        try {
+            return JSON.parse(localStorage.getItem(key));
+        } catch (e) {
+            return null;
+        }
+    };
+
+    this._save = function(key, value) {
+        localStorage.setItem(key, JSON.stringify(value));
+    };
+
+    // Reuses the last reading if it is for the same provider and key, close
+    // enough to coords and younger than weatherTtl
+    this._cachedReading = function(provider, key, coords, options) {
+        var last = this._load(STORAGE_READING);
+        if (!last || last.provider != provider || last.key != key) return null;
+        if (Date.now() - last.timestamp > options.weatherTtl) return null;
+        if (distance(last.coords, coords) > options.distanceThreshold) return null;
+        return last;
+    };
+
+    this._fetch = function(provider, key, coords, options) {
+        var cached = this._cachedReading(provider, key, coords, options);
+        if (cached) {
+            console.log('weather cached: ' + JSON.stringify(cached));
+            return this._reply(Status.AVAILABLE, {
+                tempC : cached.tempC,
+                condition : cached.condition,
+                timestamp : cached.timestamp,
+                cached : true
+            });
+        }
+
+        var fetch = this._providers[provider];
+        if (!fetch) return this._reply(Status.FAILED);
+        fetch.call(this, key, coords, function(status, tempC, condition) {
+            if (status != Status.AVAILABLE) return this._reply(status);
+            var reading = { tempC : tempC, condition : condition, timestamp : Date.now() };
+            this._save(STORAGE_READING, {
+                provider : provider,
+                key : key,
+                coords : { latitude : coords.latitude, longitude : coords.longitude },
+                tempC : tempC,
+                condition : condition,
+                timestamp : reading.timestamp
+            });
+            this._reply(status, reading);
+        }.bind(this));
+    };
+
+    // Reuses the last fix until it is fixMaxAge old, then asks for a fresh
+    // high-accuracy one
+    this._locate = function(options, success, error) {
+        var fix = this._load(STORAGE_FIX);
+        if (fix && Date.now() - fix.timestamp <= options.fixMaxAge) {
+            console.log('location cached: ' + JSON.stringify(fix));
+            return success(fix.coords);
+        }
+
+        navigator.geolocation.getCurrentPosition(function(pos) {
+            var coords = { latitude : pos.coords.latitude, longitude : pos.coords.longitude };
+            this._save(STORAGE_FIX, { coords : coords, timestamp : Date.now() });
+            success(coords);
+        }.bind(this), error, { enableHighAccuracy : true, timeout : 15000, maximumAge : 60000 });
+    };
+
+    this.appMessageHandler = function(e) {
+        var payload = e.payload;
+        if (!payload['WEATHER_REQUEST']) return;
+
+        var provider = payload['WEATHER_PROVIDER'];
+        var key = payload['WEATHER_KEY'];
+        var options = requestOptions(this._options, payload);
+        if ('WEATHER_LATITUDE' in payload && 'WEATHER_LONGITUDE' in payload) {
+            this._fetch(provider, key, {
+                latitude : payload['WEATHER_LATITUDE'] / 100000,
+                longitude : payload['WEATHER_LONGITUDE'] / 100000
+            }, options);
+        } else {
+            this._locate(options, function(coords) {
+                this._fetch(provider, key, coords, options);
+            }.bind(this), function(err) {
+                this._reply(Status.LOCATION_UNAVAILABLE);
+            }.bind(this));
+        }
+    };
+};
+
+module.exports = Weather;